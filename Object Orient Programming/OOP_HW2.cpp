@@ -6,6 +6,13 @@
 #include <functional>
 #include <iomanip>
 #include <stack>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <charconv>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 
 using namespace std;
@@ -465,6 +472,8 @@ class node {
         
         void add_phy_neighbor (unsigned int _id, string link_type = "simple_link"); // we only add a directed link from id to _id
         void del_phy_neighbor (unsigned int _id); // we only delete a directed link from id to _id
+        // the same as add_phy_neighbor for many directed links (id1, id2) at once; it is used to load a large topology
+        static void add_phy_links (vector< pair<unsigned int,unsigned int> > links, string link_type = "simple_link");
         
         // you can use the function to get the node's neigbhors at this time
         // but in the project 3, you are not allowed to use this function 
@@ -536,10 +545,91 @@ class node {
 map<string,node::node_generator*> node::node_generator::prototypes;
 map<unsigned int,node*> node::id_node_table;
 
+// forwarding information base: the route of every destination
+// a table starts as a vector sorted by the destination id (a few destinations, e.g., the flows of a switch)
+// and turns into an array indexed by the destination id once at least 1/DENSE_RATIO of the ids below the largest one are used,
+// so that the lookup of a packet touches only the slot of its destination
+// T is the route; T() must be an empty route, and T::empty() tells whether a slot has no route
+template <class T>
+class fib {
+        static const unsigned int DENSE_MIN = 64; // a smaller table is always sparse
+        static const unsigned int DENSE_RATIO = 8;
+        
+        bool dense;
+        unsigned int route_num;
+        vector<T> slots; // the dense table; slots[dst] is the route of dst
+        vector<pair<unsigned int, T>> sorted; // the sparse table, sorted by the destination id
+        
+        typename vector<pair<unsigned int, T>>::iterator lower (unsigned int dst) {
+            return lower_bound(sorted.begin(), sorted.end(), dst, 
+                [](const pair<unsigned int, T> &r, unsigned int _dst) { return r.first < _dst; });
+        }
+        void to_dense () {
+            slots.resize(sorted.back().first + 1);
+            for (unsigned int i = 0; i < sorted.size(); i ++) slots[sorted[i].first] = sorted[i].second;
+            vector<pair<unsigned int, T>>().swap(sorted);
+            dense = true;
+        }
+        
+    public:
+        fib(): dense(false), route_num(0) {}
+        
+        // the route of dst, or nullptr if there is no route
+        T * find (unsigned int dst) {
+            if (dense) return (dst < slots.size() && ! slots[dst].empty()) ? &slots[dst] : nullptr;
+            typename vector<pair<unsigned int, T>>::iterator it = lower(dst);
+            return (it != sorted.end() && it->first == dst) ? &it->second : nullptr;
+        }
+        // the route of dst; an empty route is added if there is no route, and the caller should fill it
+        T & operator[] (unsigned int dst) {
+            if (dense) {
+                if (dst >= slots.size()) slots.resize(max<size_t>(dst + 1, slots.size() * 2));
+                if (slots[dst].empty()) route_num ++;
+                return slots[dst];
+            }
+            typename vector<pair<unsigned int, T>>::iterator it = lower(dst);
+            if (it != sorted.end() && it->first == dst) return it->second;
+            route_num ++;
+            it = sorted.insert(it, make_pair(dst, T()));
+            if (sorted.size() >= DENSE_MIN && (size_t) sorted.size() * DENSE_RATIO > sorted.back().first) {
+                to_dense();
+                return slots[dst];
+            }
+            return it->second;
+        }
+        void erase (unsigned int dst) {
+            if (dense) {
+                if (dst < slots.size() && ! slots[dst].empty()) { slots[dst] = T(); route_num --; }
+                return;
+            }
+            typename vector<pair<unsigned int, T>>::iterator it = lower(dst);
+            if (it != sorted.end() && it->first == dst) { sorted.erase(it); route_num --; }
+        }
+        unsigned int size () const { return route_num; }
+        bool isDense () const { return dense; }
+        // f(dst, route) is called for every route in the increasing order of dst
+        template <class F>
+        void for_each (F f) {
+            if (dense) {
+                for (unsigned int i = 0; i < slots.size(); i ++) if (! slots[i].empty()) f(i, slots[i]);
+            }
+            else for (unsigned int i = 0; i < sorted.size(); i ++) f(sorted[i].first, sorted[i].second);
+        }
+};
+
+// a route of TRA_switch: the next hop and the counter (hop count) share 8 bytes, so a data packet reads one slot
+class TRA_route {
+    public:
+        unsigned int nex;
+        unsigned int counter;
+        TRA_route(): nex(BROCAST_ID), counter(0) {}
+        TRA_route(unsigned int _nex, unsigned int _counter): nex(_nex), counter(_counter) {}
+        bool empty() const { return nex == BROCAST_ID; }
+};
+
 class TRA_switch: public node {
         // map<unsigned int,bool> one_hop_neighbors; // you can use this variable to record the node's 1-hop neighbors 
-        map<unsigned int, unsigned int> routingTable;
-        map<unsigned int, unsigned int> counterCheck;
+        fib<TRA_route> routingTable; // the next hop and the counter of every destination
         bool hi; // this is used for example; you can remove it when doing hw2
 
     protected:
@@ -550,7 +640,7 @@ class TRA_switch: public node {
     public:
         ~TRA_switch(){}
         string type() { return "TRA_switch"; }
-        map<unsigned int, unsigned int>& getRoutingTable() { return routingTable; };
+        fib<TRA_route>& getRoutingTable() { return routingTable; };
         // please define recv_handler function to deal with the incoming packet
         virtual void recv_handler (packet *p);
         
@@ -1221,6 +1311,19 @@ class link {
             		std::cerr << "no such link type" << std::endl; // otherwise
             		return nullptr;
             	}
+            	// generate the links (id1, id2) of the same type; the pairs that cannot be generated are skipped
+            	static void generate (string type, const vector< pair<unsigned int,unsigned int> > &ids) {
+            	    if (prototypes.find(type) == prototypes.end()) {
+            		    std::cerr << "no such link type" << std::endl;
+            		    return;
+            	    }
+            	    link_generator *g = prototypes[type];
+            	    for (unsigned int i = 0; i < ids.size(); i ++) {
+            	        if ( BROCAST_ID == ids[i].first || BROCAST_ID == ids[i].second ) continue;
+            	        if (id_id_link_table.find(ids[i]) == id_id_link_table.end())
+            	            g->generate(ids[i].first, ids[i].second);
+            	    }
+            	}
             	static void print () {
             	    cout << "registered link types: " << endl;
             	    for (map<string,link::link_generator*>::iterator it = prototypes.begin(); it != prototypes.end(); it ++)
@@ -1240,6 +1343,23 @@ void node::add_phy_neighbor (unsigned int _id, string link_type){
     
     link::link_generator::generate(link_type,id,_id);
 }
+void node::add_phy_links (vector< pair<unsigned int,unsigned int> > links, string link_type){
+    // sorted links are appended to the end of each phy_neighbors
+    sort(links.begin(), links.end());
+    links.erase(unique(links.begin(), links.end()), links.end());
+    vector< pair<unsigned int,unsigned int> > added;
+    added.reserve(links.size());
+    for (unsigned int i = 0; i < links.size(); i ++) {
+        node *n = id_to_node(links[i].first);
+        unsigned int _id = links[i].second;
+        if (n == nullptr || n->id == _id || id_to_node(_id) == nullptr) continue; // the same as add_phy_neighbor
+        map<unsigned int,bool>::iterator it = n->phy_neighbors.lower_bound(_id);
+        if (it != n->phy_neighbors.end() && it->first == _id) continue;
+        n->phy_neighbors.insert(it, pair<const unsigned int,bool>(_id, true));
+        added.push_back(links[i]);
+    }
+    link::link_generator::generate(link_type, added);
+}
 void node::del_phy_neighbor (unsigned int _id){
     phy_neighbors.erase(_id);
     
@@ -1371,20 +1491,18 @@ void TRA_switch::recv_handler (packet *p){
         l3 = dynamic_cast<TRA_ctrl_payload*> (p3->getPayload());
 
         int srcID = p3->getHeader()->getSrcID();
-        if(routingTable.find(srcID) == routingTable.end()) {
-            routingTable[srcID] = p3->getHeader()->getPreID();
-            counterCheck[srcID] = l3->getCounter();
-        }
-        else if(counterCheck[srcID] < l3->getCounter()) {
-            return; // counter is biger
-        }
-        else if(routingTable[srcID] <= p3->getHeader()->getPreID()) {
-            return; // biger id in same counter
+        TRA_route &rt = routingTable[srcID]; // a single lookup; an empty route is replaced below
+        if (! rt.empty()) {
+            if(rt.counter < l3->getCounter()) {
+                return; // counter is biger
+            }
+            else if(rt.nex <= p3->getHeader()->getPreID()) {
+                return; // biger id in same counter
+            }
         }
         
-        routingTable[srcID] = p3->getHeader()->getPreID();
-        counterCheck[srcID] = l3->getCounter();
-        // cout << "id: " << getNodeID() << " preID: " << p3->getHeader()->getPreID() << " table: " << counterCheck[p3->getHeader()->getDstID()] << ' ' << l3->getCounter() << endl;
+        rt = TRA_route(p3->getHeader()->getPreID(), l3->getCounter());
+        // cout << "id: " << getNodeID() << " preID: " << p3->getHeader()->getPreID() << " table: " << routingTable[p3->getHeader()->getDstID()].counter << ' ' << l3->getCounter() << endl;
         // change contant
         p3->getHeader()->setPreID ( getNodeID() );
         p3->getHeader()->setNexID ( BROCAST_ID );
@@ -1407,11 +1525,12 @@ void TRA_switch::recv_handler (packet *p){
         l3 = dynamic_cast<TRA_data_payload*> (p3->getPayload());
 
         // change contant
-        if(routingTable.find(p3->getHeader()->getDstID()) == routingTable.end()) {
+        TRA_route *rt = routingTable.find(p3->getHeader()->getDstID()); // one lookup per data packet
+        if(rt == nullptr) {
             return; // not found
         }
         p3->getHeader()->setPreID ( getNodeID() );
-        p3->getHeader()->setNexID ( routingTable[p3->getHeader()->getDstID()] );
+        p3->getHeader()->setNexID ( rt->nex );
         // p3->getHeader()->setDstID ( BROCAST_ID );
 
         if(getNodeID() != p3->getHeader()->getDstID()) {
@@ -1478,17 +1597,184 @@ class Dst {
     int id, broadcastTime;
     Dst() {};
 };
-int main()
+
+// the whole content of a file (or of stdin); the file is memory-mapped if possible
+class mapped_input {
+        mapped_input(mapped_input&) {}
+        char *data;
+        size_t size;
+        bool mapped; // otherwise data is allocated by new
+    public:
+        mapped_input(): data(nullptr), size(0), mapped(false) {}
+        ~mapped_input() { 
+            if (mapped) munmap(data, size);
+            else delete [] data;
+        }
+        // file_name "-" is stdin
+        bool open (string file_name) {
+            FILE *fp = (file_name == "-") ? stdin : fopen(file_name.c_str(), "rb");
+            if (fp == nullptr) {
+                cerr << "cannot open " << file_name << endl;
+                return false;
+            }
+            struct stat st;
+            if (fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+                void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+                if (addr != MAP_FAILED) {
+                    data = (char*) addr;
+                    size = st.st_size;
+                    mapped = true;
+                }
+            }
+            if ( ! mapped ) { // e.g., a pipe
+                string content;
+                char buf[1 << 16];
+                size_t n;
+                while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) content.append(buf, n);
+                size = content.size();
+                data = new char[size + 1];
+                memcpy(data, content.data(), size);
+            }
+            if (fp != stdin) fclose(fp);
+            return true;
+        }
+        const char * begin () const { return data; }
+        const char * end () const { return data + size; }
+        GET(getSize,size_t,size);
+};
+
+// the integers of a text scenario; they are separated by whitespace
+class int_scanner {
+        const char *cur;
+        const char *end;
+        bool ok;
+    public:
+        int_scanner(const char *_begin, const char *_end): cur(_begin), end(_end), ok(true) {}
+        int next () {
+            while (cur < end && (*cur == ' ' || *cur == '\n' || *cur == '\r' || *cur == '\t')) cur ++;
+            int v = 0;
+            from_chars_result r = from_chars(cur, end, v);
+            if (r.ec != errc()) {
+                ok = false;
+                return 0;
+            }
+            cur = r.ptr;
+            return v;
+        }
+        GET(good,bool,ok);
+};
+
+// the input of the simulation
+// the text format is the one of the homework; the binary format is "OOPSCEN2", the 5 sizes and parameters,
+// and then the dst ids, broadcast times, links (id, node1, node2), and flows (id, src, dst, size, startTime) as 32-bit integers
+class scenario {
+        static const char BINARY_MAGIC[9];
+        bool parse_text (const char *begin, const char *end);
+        bool parse_binary (const char *begin, const char *end);
+    public:
+        int nodeSize, dstSize, linkSize, pairSize, simTime;
+        vector<Dst> dstList;
+        vector<Link> linkList;
+        vector<Flow> flowList;
+        
+        scenario(): nodeSize(0), dstSize(0), linkSize(0), pairSize(0), simTime(0) {}
+        // read a text or binary scenario; file_name "-" is stdin
+        bool load (string file_name);
+        bool save_binary (string file_name) const;
+};
+const char scenario::BINARY_MAGIC[9] = "OOPSCEN2";
+
+bool scenario::load (string file_name) {
+    mapped_input in;
+    if ( ! in.open(file_name) ) return false;
+    bool ok;
+    if (in.getSize() >= 8 && memcmp(in.begin(), BINARY_MAGIC, 8) == 0)
+        ok = parse_binary(in.begin() + 8, in.end());
+    else
+        ok = parse_text(in.begin(), in.end());
+    if ( ! ok ) cerr << file_name << " is not a valid scenario" << endl;
+    return ok;
+}
+bool scenario::parse_text (const char *begin, const char *end) {
+    int_scanner in(begin, end);
+    nodeSize = in.next(); dstSize = in.next(); linkSize = in.next(); pairSize = in.next(); simTime = in.next();
+    if ( ! in.good() || nodeSize < 0 || dstSize < 0 || linkSize < 0 || pairSize < 0 ) return false;
+    dstList.resize(dstSize);
+    linkList.resize(linkSize);
+    flowList.resize(pairSize);
+    for(int i = 0; i < dstSize; i++) dstList[i].id = in.next();
+    for(int i = 0; i < dstSize; i++) { dstList[i].id = in.next(); dstList[i].broadcastTime = in.next(); }
+    for(int i = 0; i < linkSize; i++) { linkList[i].id = in.next(); linkList[i].node1 = in.next(); linkList[i].node2 = in.next(); }
+    for(int i = 0; i < pairSize; i++) { 
+        flowList[i].id = in.next(); flowList[i].src = in.next(); flowList[i].dst = in.next(); 
+        flowList[i].size = in.next(); flowList[i].startTime = in.next(); 
+    }
+    return in.good();
+}
+bool scenario::parse_binary (const char *begin, const char *end) {
+    const char *cur = begin;
+    auto read = [&cur, end] (int *v, size_t n) {
+        if ((size_t)(end - cur) < n * sizeof(int)) return false;
+        memcpy(v, cur, n * sizeof(int));
+        cur += n * sizeof(int);
+        return true;
+    };
+    int sizes[5];
+    if ( ! read(sizes, 5) ) return false;
+    nodeSize = sizes[0]; dstSize = sizes[1]; linkSize = sizes[2]; pairSize = sizes[3]; simTime = sizes[4];
+    if ( nodeSize < 0 || dstSize < 0 || linkSize < 0 || pairSize < 0 ) return false;
+    dstList.resize(dstSize);
+    linkList.resize(linkSize);
+    flowList.resize(pairSize);
+    for(int i = 0; i < dstSize; i++) if ( ! read(&dstList[i].id, 1) ) return false;
+    for(int i = 0; i < dstSize; i++) if ( ! read(&dstList[i].broadcastTime, 1) ) return false;
+    for(int i = 0; i < linkSize; i++) {
+        int v[3];
+        if ( ! read(v, 3) ) return false;
+        linkList[i].id = v[0]; linkList[i].node1 = v[1]; linkList[i].node2 = v[2];
+    }
+    for(int i = 0; i < pairSize; i++) {
+        int v[5];
+        if ( ! read(v, 5) ) return false;
+        flowList[i].id = v[0]; flowList[i].src = v[1]; flowList[i].dst = v[2]; flowList[i].size = v[3]; flowList[i].startTime = v[4];
+    }
+    return true;
+}
+bool scenario::save_binary (string file_name) const {
+    FILE *fp = fopen(file_name.c_str(), "wb");
+    if (fp == nullptr) {
+        cerr << "cannot create " << file_name << endl;
+        return false;
+    }
+    vector<int> out;
+    out.reserve(5 + 2 * dstSize + 3 * linkSize + 5 * pairSize);
+    int sizes[5] = { nodeSize, dstSize, linkSize, pairSize, simTime };
+    out.insert(out.end(), sizes, sizes + 5);
+    for (const Dst &d: dstList) out.push_back(d.id);
+    for (const Dst &d: dstList) out.push_back(d.broadcastTime);
+    for (const Link &l: linkList) { out.push_back(l.id); out.push_back(l.node1); out.push_back(l.node2); }
+    for (const Flow &f: flowList) { out.push_back(f.id); out.push_back(f.src); out.push_back(f.dst); out.push_back(f.size); out.push_back(f.startTime); }
+    bool ok = fwrite(BINARY_MAGIC, 1, 8, fp) == 8 && fwrite(out.data(), sizeof(int), out.size(), fp) == out.size();
+    ok = (fclose(fp) == 0) && ok;
+    if ( ! ok ) cerr << "cannot write " << file_name << endl;
+    return ok;
+}
+int main(int argc, char *argv[])
 {
-    int nodeSize, dstSize, linkSize, pairSize, simTime;
-    cin >> nodeSize >> dstSize >> linkSize >> pairSize >> simTime;
-    vector<Dst> dstList(dstSize);
-    vector<Link> linkList(linkSize);
-    vector<Flow> flowList(pairSize);
-    for(int i = 0; i < dstSize; i++) cin >> dstList[i].id;
-    for(int i = 0; i < dstSize; i++) cin >> dstList[i].id >> dstList[i].broadcastTime;
-    for(int i = 0; i < linkSize; i++) cin >> linkList[i].id >> linkList[i].node1 >> linkList[i].node2;
-    for(int i = 0; i < pairSize; i++) cin >> flowList[i].id >> flowList[i].src >> flowList[i].dst >> flowList[i].size >> flowList[i].startTime;
+    if (argc > 3 && string(argv[1]) == "--convert-scenario") { // "./OOP_HW2 --convert-scenario input.txt output.bin"
+        scenario s;
+        return (s.load(argv[2]) && s.save_binary(argv[3])) ? 0 : 1;
+    }
+    string scenario_file = "-"; // "./OOP_HW2 --scenario input.bin"; the input is read from stdin by default
+    for (int i = 1; i + 1 < argc; i ++)
+        if (string(argv[i]) == "--scenario") scenario_file = argv[i + 1];
+    
+    scenario input;
+    if ( ! input.load(scenario_file) ) return 1;
+    int nodeSize = input.nodeSize, simTime = input.simTime;
+    vector<Dst> &dstList = input.dstList;
+    vector<Link> &linkList = input.linkList;
+    vector<Flow> &flowList = input.flowList;
 
     // // check input
     // cout << "-----------\nout:\n\nsimTime:" << simTime << endl;
@@ -1513,10 +1799,15 @@ int main()
     // unsigned int con_id = node::getNodeNum(); // controller id is the last one
     
     // set switches' neighbors
+    vector< pair<unsigned int,unsigned int> > phy_links;
+    phy_links.reserve(2 * linkList.size());
     for(auto link: linkList) {
-        node::id_to_node(link.node1)->add_phy_neighbor(link.node2);
-        node::id_to_node(link.node2)->add_phy_neighbor(link.node1);
+        // node::id_to_node(link.node1)->add_phy_neighbor(link.node2);
+        // node::id_to_node(link.node2)->add_phy_neighbor(link.node1);
+        phy_links.push_back(pair<unsigned int,unsigned int>(link.node1, link.node2));
+        phy_links.push_back(pair<unsigned int,unsigned int>(link.node2, link.node1));
     }
+    node::add_phy_links(phy_links);
 
     // for(int id = 0; id < nodeSize; id++) {
     //     node *n = node::id_to_node(id);
@@ -1554,9 +1845,9 @@ int main()
     for(int id = 0; id < nodeSize; id++) {
         cout << id << endl;
         TRA_switch *tra = (TRA_switch*)node::id_to_node(id);
-        for(auto t: tra->getRoutingTable()) {
-            cout << t.first << ' ' << t.second << endl;
-        }
+        tra->getRoutingTable().for_each([](unsigned int dst, TRA_route &rt) {
+            cout << dst << ' ' << rt.nex << endl;
+        });
     }
     return 0;
 }
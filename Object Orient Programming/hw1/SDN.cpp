@@ -1,185 +1,315 @@
 #include <iostream>
 #include <vector>
 #include <map>
-#include <queue>
- 
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <string>
+
 using namespace std;
- 
-class Node {
+
+// the graph in compressed sparse row form: the neighbors of node i are adj[offset[i]] ... adj[offset[i + 1] - 1],
+// in the order of the links in the input
+class Graph {
     private:
     public:
-        unsigned int id;
-        vector<unsigned int> neighbors;
-        map<unsigned int, unsigned int> level; // dst, level
+        unsigned int nodeLen;
+        vector<unsigned int> offset;
+        vector<unsigned int> adj;
 
-        virtual ~Node(){};
-        Node(){id = -1;};
+        Graph(){nodeLen = 0;};
+        void build(unsigned int _nodeLen, const vector<pair<unsigned int, unsigned int>>& links);
+        unsigned int degree(unsigned int id) const {return offset[id + 1] - offset[id];};
+        const unsigned int* begin(unsigned int id) const {return adj.data() + offset[id];};
+        const unsigned int* end(unsigned int id) const {return adj.data() + offset[id + 1];};
 };
- 
-class SDN_Node : public Node {
+
+const unsigned int UNREACHED = UINT_MAX;
+
+// the buffers of one BFS; every thread keeps its own, so nothing is allocated per destination
+class BFS_Workspace {
     private:
     public:
-        // destination ID, <next nodes’ IDs, portions>
-        map<unsigned int, vector<pair<unsigned int, double>>>  routingTable;
-        SDN_Node(){};
-        SDN_Node(unsigned int index){id = index;};
+        vector<unsigned int> queue;
+        vector<unsigned long long> visited; // one bit per node, so it stays in the cache
 };
-class OSPF_Node : public Node{
+
+// the routes to all destinations; the arrays are laid out as destination x node,
+// so level[k * nodeLen + i] is the number of hops from node i to dsts[k] (UNREACHED if there is no path)
+// and parent[k * nodeLen + i] is the next hop of node i toward dsts[k]
+class Routes {
     private:
     public:
-        // destination ID, next node's ID
-        map<unsigned int, unsigned int> routingTable;
-        OSPF_Node(){};
-        OSPF_Node(unsigned int index){id = index;};
+        unsigned int nodeLen;
+        vector<unsigned int> dsts;
+        vector<unsigned int> level;
+        vector<unsigned int> parent;
+        vector<bool> isSDN;
+        // SDN node ID, <destination index, <next nodes' IDs, portions>>
+        map<unsigned int, vector<vector<pair<unsigned int, double>>>> SDNTable;
+
+        const unsigned int* levels(unsigned int k) const {return level.data() + (size_t)k * nodeLen;};
 };
- 
-void BFS(vector<Node*>& nodes, unsigned int id, vector<bool>& visited);
-void show_answer(int nodeLen, vector<Node*>& nodes, vector<unsigned int>& dsts);
-void expand_SDN_link(vector<Node*>& nodes, unsigned int sdnID, vector<unsigned int>& dsts);
-
-SDN_Node *isTypeOfSDN = nullptr;
-OSPF_Node *isTypeOfOSPF = nullptr;
-int main()
+
+void BFS(const Graph& graph, Routes& routes, unsigned int k, BFS_Workspace& work);
+void solve_all(const Graph& graph, Routes& routes, unsigned int threadLen);
+bool found_before(const Graph& graph, const unsigned int* parent, unsigned int a, unsigned int b);
+void expand_SDN_link(const Graph& graph, Routes& routes, unsigned int sdnID);
+void show_answer(const Graph& graph, Routes& routes);
+void append_uint(string& out, unsigned int v);
+
+// the input is read at once; the million-node graphs are too slow for cin
+class Reader {
+    private:
+        vector<char> data;
+        size_t pos;
+    public:
+        Reader(FILE* fp);
+        unsigned int next();
+};
+
+int main(int argc, char* argv[])
 {
+    // "./SDN --threads 8" solves 8 destinations at a time; all cores are used by default
+    unsigned int threadLen = thread::hardware_concurrency();
+    for(int i = 1; i + 1 < argc; i++)
+        if(string(argv[i]) == "--threads") threadLen = stoul(argv[i + 1]);
+    if(threadLen == 0) threadLen = 1;
+
     // init
     //#Nodes #SDN_Nodes #Dsts #Links #Pairs
-    int nodeLen, SDNLen, dstLen, linklen, flowLen;
-    cin >> nodeLen >> SDNLen >> dstLen >> linklen >> flowLen;
-    vector<unsigned int> SDNs(SDNLen), dsts(dstLen);
-    for(int i = 0; i < SDNLen; i++) cin >> SDNs[i];
-    for(int i = 0; i < dstLen; i++) cin >> dsts[i];
-    vector<vector<unsigned int>> links(linklen, vector<unsigned int>(3)), flows(flowLen, vector<unsigned int>(4));
-    for(int i = 0; i < linklen; i++) cin >> links[i][0] >> links[i][1] >> links[i][2]; // link: LinkID, Node1, Node2
-    for(int i = 0; i < flowLen; i++) cin >> flows[i][0] >> flows[i][1] >> flows[i][2] >> flows[i][3]; // flows: FlowID, Src, Dst, FlowSize
-    vector<Node*> nodes; // include SDN, OSPF node
-    for(int i = 0, j = 0; i < nodeLen; i++)
+    Reader in(stdin);
+    unsigned int nodeLen = in.next(), SDNLen = in.next(), dstLen = in.next(), linklen = in.next(), flowLen = in.next();
+    vector<unsigned int> SDNs(SDNLen);
+    Routes routes;
+    routes.nodeLen = nodeLen;
+    routes.dsts.resize(dstLen);
+    routes.isSDN.assign(nodeLen, false);
+    for(unsigned int i = 0; i < SDNLen; i++)
     {
-        if(j < SDNLen && (unsigned int)i == SDNs[j]) // store SDN node
-        {
-            nodes.push_back(new SDN_Node(i));
-            j++;
-        }
-        else nodes.push_back(new OSPF_Node(i)); // store OSPF node
+        SDNs[i] = in.next();
+        if(SDNs[i] < nodeLen) routes.isSDN[SDNs[i]] = true; // store SDN node
     }
- 
-    for(int i = 0; i < linklen; i++) // build graph
+    for(unsigned int i = 0; i < dstLen; i++) routes.dsts[i] = in.next();
+    vector<pair<unsigned int, unsigned int>> links(linklen);
+    for(unsigned int i = 0; i < linklen; i++) // link: LinkID, Node1, Node2
     {
-        nodes[links[i][1]]->neighbors.push_back(links[i][2]);
-        nodes[links[i][2]]->neighbors.push_back(links[i][1]);
+        in.next();
+        links[i].first = in.next();
+        links[i].second = in.next();
     }
+    for(unsigned int i = 0; i < flowLen * 4; i++) in.next(); // flows: FlowID, Src, Dst, FlowSize; they are not used
+    for(auto d: routes.dsts) if(d >= nodeLen) { cerr << "no node " << d << endl; return 1; }
+    for(auto& l: links) if(l.first >= nodeLen || l.second >= nodeLen) { cerr << "no node " << max(l.first, l.second) << endl; return 1; }
+
+    Graph graph;
+    graph.build(nodeLen, links); // build graph
     // init finish
     // start
- 
-    for(auto d: dsts) // iterator all dsts
+
+    solve_all(graph, routes, threadLen);
+
+    for(auto s: SDNs) // add sdn node link
     {
-        vector<bool> visited(nodeLen, 0);
-        BFS(nodes, d, visited);
+        if(s < nodeLen) expand_SDN_link(graph, routes, s);
     }
+    show_answer(graph, routes);
+
+    return 0;
+}
 
-    for(auto s: SDNs) // add sdn node link 
+void Graph::build(unsigned int _nodeLen, const vector<pair<unsigned int, unsigned int>>& links)
+{
+    nodeLen = _nodeLen;
+    offset.assign(nodeLen + 1, 0);
+    for(auto& l: links)
     {
-        expand_SDN_link(nodes, s, dsts);
+        offset[l.first + 1]++;
+        offset[l.second + 1]++;
+    }
+    for(unsigned int i = 0; i < nodeLen; i++) offset[i + 1] += offset[i];
+    adj.resize(offset[nodeLen]);
+    vector<unsigned int> fill(offset.begin(), offset.end() - 1);
+    for(auto& l: links) // the same order as pushing the neighbors link by link
+    {
+        adj[fill[l.first]++] = l.second;
+        adj[fill[l.second]++] = l.first;
     }
-    show_answer(nodeLen, nodes, dsts);
- 
-    return 0;
 }
- 
- 
-void BFS(vector<Node*>& nodes, unsigned int start, vector<bool>& visited)
+
+// the levels and the next hops of all nodes toward dsts[k]; the next hop of a node is the node that reached it first in
+// a queue-based BFS from the destination, as the original solver: the neighbor one hop closer that the BFS found first,
+// which is not always the first one in the order of the links
+void BFS(const Graph& graph, Routes& routes, unsigned int k, BFS_Workspace& work)
 {
-    queue<unsigned int> que;
-    que.push(start);
-    visited[start] = 1;
-    unsigned int level = 0;
-    nodes[start]->level.insert({start, level});
-    while(que.size())
+    unsigned int* level = routes.level.data() + (size_t)k * routes.nodeLen;
+    unsigned int* parent = routes.parent.data() + (size_t)k * routes.nodeLen;
+    vector<unsigned long long>& visited = work.visited;
+    vector<unsigned int>& queue = work.queue;
+    unsigned int d = routes.dsts[k];
+    visited.assign((graph.nodeLen + 63) / 64, 0);
+    visited[d >> 6] |= 1ULL << (d & 63);
+    level[d] = 0;
+    queue.clear();
+    queue.push_back(d);
+    for(size_t h = 0; h < queue.size(); h++)
     {
-        unsigned int id = que.front(); // get current node id
- 
-        for(auto nextId: nodes[id]->neighbors) // add next node
+        unsigned int id = queue[h];
+        for(const unsigned int* it = graph.begin(id); it != graph.end(id); it++)
         {
-            if(!visited[nextId])
-            {
-                que.push(nextId);
-                visited[nextId] = 1;
-                nodes[nextId]->level.insert({start, level});
-                if(isTypeOfSDN = dynamic_cast<SDN_Node*>(nodes[nextId])) // nextId is SDN node
-                    isTypeOfSDN->routingTable.insert({start, {{id, 1}}});
-                else if(isTypeOfOSPF = dynamic_cast<OSPF_Node*>(nodes[nextId])) // next is OSPF node
-                    isTypeOfOSPF->routingTable.insert({start, id});
-            }
+            if(visited[*it >> 6] >> (*it & 63) & 1) continue;
+            visited[*it >> 6] |= 1ULL << (*it & 63);
+            level[*it] = level[id] + 1;
+            parent[*it] = id;
+            queue.push_back(*it);
         }
-        que.pop();
-        level++;
     }
-    return;
 }
 
-void expand_SDN_link(vector<Node*>& nodes, unsigned int sdnID, vector<unsigned int>& dsts)
+// the threads take the destinations one by one
+void solve_all(const Graph& graph, Routes& routes, unsigned int threadLen)
+{
+    unsigned int dstLen = routes.dsts.size();
+    routes.level.assign((size_t)dstLen * routes.nodeLen, UNREACHED);
+    routes.parent.assign((size_t)dstLen * routes.nodeLen, UNREACHED);
+    atomic<unsigned int> nextDst(0);
+    auto worker = [&]()
+    {
+        BFS_Workspace work;
+        for(unsigned int k; (k = nextDst++) < dstLen; ) BFS(graph, routes, k, work);
+    };
+    vector<thread> pool;
+    for(unsigned int i = 1; i < min(threadLen, dstLen); i++) pool.push_back(thread(worker));
+    worker();
+    for(auto& t: pool) t.join();
+}
+
+// whether the BFS toward the destination found a before b; a and b are at the same level, and the one whose branch
+// leaves the common ancestor first was found first
+bool found_before(const Graph& graph, const unsigned int* parent, unsigned int a, unsigned int b)
+{
+    while(parent[a] != parent[b])
+    {
+        a = parent[a];
+        b = parent[b];
+    }
+    for(const unsigned int* it = graph.begin(parent[a]); ; it++)
+    {
+        if(*it == a) return true;
+        if(*it == b) return false;
+    }
+}
+
+// an SDN node splits the traffic equally among the neighbors that the original solver took: the ones one hop closer to
+// the destination, and the ones at the same level whose next hop was found by the BFS not later than its own
+// (the original solver compared the queue positions of the next hops); all neighbors if the destination is unreachable
+void expand_SDN_link(const Graph& graph, Routes& routes, unsigned int sdnID)
 {
-    SDN_Node& SDNnode = *(SDN_Node*)nodes[sdnID];
-    for(auto d: dsts)
+    vector<vector<pair<unsigned int, double>>>& table = routes.SDNTable[sdnID];
+    table.assign(routes.dsts.size(), vector<pair<unsigned int, double>>());
+    for(unsigned int k = 0; k < routes.dsts.size(); k++)
     {
+        const unsigned int* level = routes.levels(k);
+        const unsigned int* parent = routes.parent.data() + (size_t)k * routes.nodeLen;
         int count = 0;
-        SDNnode.routingTable[d].clear();
-        for(auto nextId: SDNnode.neighbors)
+        for(const unsigned int* it = graph.begin(sdnID); it != graph.end(sdnID); it++)
         {
-            if(nodes[nextId]->level[d] <= SDNnode.level[d])
+            bool taken = level[sdnID] == UNREACHED || level[*it] + 1 == level[sdnID];
+            if(level[sdnID] != UNREACHED && level[sdnID] > 0 && level[*it] == level[sdnID])
+                taken = parent[*it] == parent[sdnID] || found_before(graph, parent, parent[*it], parent[sdnID]);
+            if(taken)
             {
-                SDNnode.routingTable[d].push_back({nextId, 1});
-                // cout << "link!!! " << sdnID << ' ' << nextId << endl;
+                table[k].push_back({*it, 1});
                 count++;
             }
             else
-                SDNnode.routingTable[d].push_back({nextId, 0});
+                table[k].push_back({*it, 0});
         }
-        for(auto& t: SDNnode.routingTable[d])
+        for(auto& t: table[k])
         {
-            t.second = t.second / count;
+            if(count > 0) t.second = t.second / count;
         }
     }
 }
-void show_answer(int nodeLen, vector<Node*>& nodes, vector<unsigned int>& dsts)
+
+// the decimal digits of v
+void append_uint(string& out, unsigned int v)
+{
+    char buf[12];
+    int len = 0;
+    do { buf[len++] = '0' + v % 10; v /= 10; } while(v);
+    while(len) out += buf[--len];
+}
+
+void show_answer(const Graph& graph, Routes& routes)
 {
-    for(int i = 0; i < nodeLen; i++)
+    // there is one line per node and destination, so the lines are formatted in a buffer and written with fwrite
+    string out;
+    out.reserve(1 << 21);
+    auto flush = [&]() { fwrite(out.data(), 1, out.size(), stdout); out.clear(); };
+    for(unsigned int i = 0; i < graph.nodeLen; i++)
     {
-        cout << i << endl;
-        if(isTypeOfSDN = dynamic_cast<SDN_Node*>(nodes[i])) // is SDN node
+        append_uint(out, i);
+        out += '\n';
+        if(routes.isSDN[i]) // is SDN node
         {
-            for(auto d : dsts)
+            const vector<vector<pair<unsigned int, double>>>& table = routes.SDNTable[i];
+            for(unsigned int k = 0; k < routes.dsts.size(); k++)
             {
-                cout << d << ' ';
-                if(d == isTypeOfSDN->id) // dst is self
+                unsigned int d = routes.dsts[k];
+                append_uint(out, d);
+                out += ' ';
+                if(d == i) // dst is self
                 {
-                    cout << d << " 100%"<< endl;
+                    append_uint(out, d);
+                    out += " 100%\n";
                     continue;
                 }
-                else
+                for(auto t: table[k])
                 {
-                    for(auto t: isTypeOfSDN->routingTable[d])
-                    {
-                        cout << t.first << ' '  << (int)(t.second * 100) << "% ";
-                    }
-                    cout << endl;
+                    append_uint(out, t.first);
+                    out += ' ';
+                    append_uint(out, (int)(t.second * 100));
+                    out += "% ";
                 }
-                // cout << "level: " << nodes[i]->level[d] << endl;
+                out += '\n';
             }
         }
-        else if(isTypeOfOSPF = dynamic_cast<OSPF_Node*>(nodes[i])) // is OSPF node
+        else // is OSPF node
         {
-            for(auto d : dsts)
+            for(unsigned int k = 0; k < routes.dsts.size(); k++)
             {
-                cout << d << ' ';
-                if(d == isTypeOfOSPF->id) // dst is self
-                    cout << d << endl;
-                else cout << isTypeOfOSPF->routingTable[d] << endl;
-                // cout << "level: " << nodes[i]->level[d] << endl;
+                unsigned int d = routes.dsts[k];
+                unsigned int p = routes.parent[(size_t)k * routes.nodeLen + i];
+                append_uint(out, d);
+                out += ' ';
+                if(d == i) append_uint(out, d); // dst is self
+                else append_uint(out, p == UNREACHED ? 0 : p); // 0 if there is no path, as before
+                out += '\n';
             }
         }
+        if(out.size() > (1 << 20)) flush();
     }
+    flush();
     return;
 }
+
+Reader::Reader(FILE* fp)
+{
+    char buf[1 << 16];
+    size_t n;
+    while((n = fread(buf, 1, sizeof(buf), fp)) > 0) data.insert(data.end(), buf, buf + n);
+    pos = 0;
+}
+unsigned int Reader::next()
+{
+    while(pos < data.size() && (data[pos] < '0' || data[pos] > '9')) pos++;
+    unsigned int v = 0;
+    while(pos < data.size() && data[pos] >= '0' && data[pos] <= '9') v = v * 10 + (data[pos++] - '0');
+    return v;
+}
 // 15 3 1 28 3
 // 2 9 14
 // 0
@@ -216,4 +346,4 @@ void show_answer(int nodeLen, vector<Node*>& nodes, vector<unsigned int>& dsts)
 // 2 3 0 5
 
 // https://stackoverflow.com/questions/26208918/vector-that-can-have-3-different-data-types-c
-// https://yayaya6d.pixnet.net/blog/post/350055421-c%2B%2B%E5%90%84%E7%A8%AE%E9%9B%9C%E8%AB%87--%E8%99%9B%E6%93%AC%E5%87%BD%E5%BC%8F%28virtual-function%29
\ No newline at end of file
+// https://yayaya6d.pixnet.net/blog/post/350055421-c%2B%2B%E5%90%84%E7%A8%AE%E9%9B%9C%E8%AB%87--%E8%99%9B%E6%93%AC%E5%87%BD%E5%BC%8F%28virtual-function%29